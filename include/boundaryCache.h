@@ -0,0 +1,82 @@
+/**
+* This software was developed at the National Institute of Standards and Technology (NIST) by
+* employees of the Federal Government in the course of their official duties. Pursuant to title
+* 17 Section 105 of the United States Code, this software is not subject to copyright protection
+* and is in the public domain. NIST assumes no responsibility  whatsoever for its use by other
+* parties, and makes no guarantees, expressed or implied, about its quality, reliability, or any
+* other characteristic.
+*/
+#ifndef BOUNDARY_CACHE_H_
+#define BOUNDARY_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include "irisFinder.h"
+
+// Persistent, content-addressed store of localization results, kept in a memory-mapped file.
+// The file is locked while open; a second process opening it fails rather than waiting, so
+// concurrent workers should each use their own cache file.
+class BoundaryCache
+{
+   public:
+      BoundaryCache(const std::string& path, const size_t capacity = 4096);
+      ~BoundaryCache();
+
+      BoundaryCache(const BoundaryCache&) = delete;
+      BoundaryCache& operator = (const BoundaryCache&) = delete;
+
+      // Hash of the pixel data, the finder parameters and the library version.
+      static uint64_t key(const Mat& image, const IrisFinder& finder);
+
+      // Retrieves the boundaries stored under the given key, if any.
+      bool find(const uint64_t key, IrisBoundary& pupil, IrisBoundary& limbus);
+
+      // Stores the boundaries under the given key.
+      void insert(const uint64_t key, const IrisBoundary& pupil, const IrisBoundary& limbus);
+
+      size_t hits()   const { return _hits;   };
+      size_t misses() const { return _misses; };
+      float hitRate() const;
+
+   protected:
+      struct Header
+      {
+         char     magic[8];
+         uint64_t capacity,               // number of slots (power of two)
+                  count;                  // number of occupied slots
+      };
+
+      struct Entry
+      {
+         uint64_t key;                    // 0 marks an empty slot
+         float    pupil[4],               // x, y, a, b
+                  limbus[4];
+      };
+
+      // Maps an existing cache file, or initializes an empty one with the given number of slots.
+      void load(const size_t capacity);
+
+      // Truncates the file and lays out an empty table of at least the given number of slots.
+      void initialize(const size_t capacity);
+
+      // Maps the file, sized to hold the given number of slots.
+      void map(const size_t capacity);
+      void unmap();
+
+      // Doubles the number of slots, rehashing existing entries.
+      void grow();
+
+      // Slot holding the key, or the empty slot where it belongs (null if full).
+      Entry* slot(const uint64_t key) const;
+
+      std::string _path;
+      int         _fd = -1;
+      size_t      _bytes = 0;
+      Header*     _header = nullptr;
+      Entry*      _entries = nullptr;
+
+      size_t      _hits = 0,
+                  _misses = 0;
+};
+
+#endif // BOUNDARY_CACHE_H_
@@ -16,6 +16,9 @@
 using cv::Mat;
 using cv::Mat1b;
 
+// Bumped whenever a change alters the boundaries produced for a given image and parameters.
+constexpr int IrisFinderVersion = 2;
+
 class IrisFinder
 {
    public:
@@ -36,6 +39,24 @@ class IrisFinder
       // Measures the strength of the given iris boundary.
       float boundaryStrength(const IrisBoundary& boundary) const;
 
+      // Unwraps the annulus between the boundaries into a fixed size polar strip, along with
+      // the matching LED occlusion mask (0 where occluded or outside the image).
+      void normalizedIris(const IrisBoundary& pupil, const IrisBoundary& limbus,
+                          Mat& iris, Mat1b& mask) const;
+
+      // As above, for boundaries already known for the given image (e.g. from a cache). Prepares
+      // only what normalization needs; call setImage before localizing again.
+      void normalizedIris(const Mat& image, const IrisBoundary& pupil, const IrisBoundary& limbus,
+                          Mat& iris, Mat1b& mask);
+
+      // Estimated peak working memory, in bytes, for the current image, including the localization
+      // that follows setImage. Modeled from the sizes of the finder's own buffers; scratch memory
+      // inside OpenCV calls is not included.
+      size_t peakBytes() const { return _peakBytes; };
+
+      // Lists every parameter that influences localization (used to key cached results).
+      void parameters(vector<float>& params) const;
+
       int MinLedArea            =   10, // minimum area of an LED specular highlight
           MaxLedArea            = 3000, // maximum area of an LED specular highlight
           MinLedIntensity       =  230, // minimum pixel intensity to constitute an LED point
@@ -49,23 +70,42 @@ class IrisFinder
           MinPupilContourLength =   13, // minimum length of a pupil boundary contour
           MinAnnulusThickness   =   36, // minimum pixel thickness of the annulus
           MinLimbusRadius       =   86, // minimum pixel radius of the limbus
-          MaxLimbusRadius       =  200; // maximum pixel radius of the limbus
+          MaxLimbusRadius       =  200, // maximum pixel radius of the limbus
+          NormalizedWidth       =  256, // angular samples in the normalized iris strip
+          NormalizedHeight      =   64; // radial samples in the normalized iris strip
 
       float GradientSigma       = 2.4,  // blur to apply prior to gradient computation
             MinBoundaryGradient = 4.1,  // minimum gradient to constitute a boundary
             AngleTolerance      = cos(M_PI / 10); // angle tolerance of gradient at boundary point
 
+      size_t MemoryBudget       = 0;    // maximum working memory in bytes (0 = unlimited)
+
    protected:
 
+      // Prepares only the raw image and LED mask.
+      void prepareImage(const Mat& image);
+
       // Apply optimization algorithm to fine tune the boundary fit.
       void optimizeFit(IrisBoundary& boundary) const;
 
-      Mat _image,                       // original (contrast enhanced) image
+      // Number of pupil radii whose hough accumulator fits in the memory budget at once.
+      int radiusBand() const;
+
+      // Bytes held by the image planes between calls.
+      size_t residentBytes() const;
+
+      // Updates the peak working memory with the given transient usage.
+      void account(const size_t transient);
+
+      Mat _raw,                         // original single-channel 8-bit image
+          _image,                       // original (contrast enhanced) image
           _gradX,                       // gradient in the horizontal direction
           _gradY,                       // gradient in the vertical direction
           _gradMag;                     // gradient magnitude
 
       Mat1b _mask;                      // LED specular highlight neighbouring region
+
+      size_t _peakBytes = 0;            // estimated peak working memory for the current image
 };
 
 #endif // IRIS_FINDER_H_
@@ -0,0 +1,296 @@
+/**
+* This software was developed at the National Institute of Standards and Technology (NIST) by
+* employees of the Federal Government in the course of their official duties. Pursuant to title
+* 17 Section 105 of the United States Code, this software is not subject to copyright protection
+* and is in the public domain. NIST assumes no responsibility  whatsoever for its use by other
+* parties, and makes no guarantees, expressed or implied, about its quality, reliability, or any
+* other characteristic.
+*/
+#include "boundaryCache.h"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char Magic[8] = { 'I', 'R', 'I', 'S', 'C', 'A', 'C', '1' };
+
+// 64-bit FNV-1a hash, continuing from the given hash value.
+static inline uint64_t fnv1a(const void* data, const size_t size,
+                             uint64_t hash = 0xcbf29ce484222325ULL)
+{
+   const uint8_t* bytes = (const uint8_t*)data;
+
+   for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+
+   return hash;
+}
+
+// Packs boundary parameters into a cache entry field.
+static inline void store(float* dst, const IrisBoundary& b)
+{
+   dst[0] = b.x;
+   dst[1] = b.y;
+   dst[2] = b.a;
+   dst[3] = b.b;
+}
+
+BoundaryCache::BoundaryCache(const std::string& path, const size_t capacity) : _path(path)
+{
+   _fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+   if (_fd < 0)
+      throw std::runtime_error("Unable to open boundary cache " + path);
+
+   try
+   {
+      // Another process growing the file under our mapping would corrupt it, so refuse to share.
+      if (flock(_fd, LOCK_EX | LOCK_NB) != 0)
+         throw std::runtime_error("Boundary cache " + path + " is in use by another process");
+
+      load(capacity);
+   }
+   catch (...)
+   {
+      close(_fd);
+      throw;
+   }
+}
+
+BoundaryCache::~BoundaryCache()
+{
+   unmap();
+
+   if (_fd >= 0)
+      close(_fd);
+}
+
+// Hash of the pixel data, the finder parameters and the library version.
+uint64_t BoundaryCache::key(const Mat& image, const IrisFinder& finder)
+{
+   const int version = IrisFinderVersion,
+             header[] = { image.rows, image.cols, image.type() };
+
+   vector<float> params;
+   finder.parameters(params);
+
+   uint64_t hash = fnv1a(&version, sizeof(version));
+   hash = fnv1a(params.data(), params.size() * sizeof(float), hash);
+   hash = fnv1a(header, sizeof(header), hash);
+
+   // Rows may be padded, so hash only the pixels.
+   const size_t rowBytes = image.cols * image.elemSize();
+
+   for (int r = 0; r < image.rows; ++r)
+      hash = fnv1a(image.ptr(r), rowBytes, hash);
+
+   // Zero is reserved for empty slots.
+   return hash ? hash : 1;
+}
+
+// Maps an existing cache file, or initializes an empty one with the given number of slots.
+void BoundaryCache::load(const size_t capacity)
+{
+   struct stat st;
+
+   if (fstat(_fd, &st) != 0)
+      throw std::runtime_error("Unable to open boundary cache " + _path);
+
+   if (st.st_size == 0)
+   {
+      initialize(capacity);
+      return;
+   }
+
+   // Existing cache, validate the header before mapping the slots.
+   Header header;
+
+   const bool valid = pread(_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                      memcmp(header.magic, Magic, sizeof(Magic)) == 0 &&
+                      header.capacity > 0 &&
+                      (header.capacity & (header.capacity - 1)) == 0 &&
+                      header.capacity <= (SIZE_MAX - sizeof(Header)) / sizeof(Entry) &&
+                      size_t(st.st_size) == sizeof(Header) + header.capacity * sizeof(Entry);
+
+   // A damaged cache (e.g. a worker killed while growing it) only costs recomputation.
+   if (!valid)
+   {
+      std::cerr << "Invalid boundary cache " << _path << ", starting afresh" << std::endl;
+      initialize(capacity);
+      return;
+   }
+
+   map(header.capacity);
+
+   // Recount, since an interrupted insert can leave the stored count short.
+   size_t count = 0;
+
+   for (size_t i = 0; i < _header->capacity; ++i)
+      if (_entries[i].key)
+         ++count;
+
+   if (2 * count > _header->capacity)
+   {
+      std::cerr << "Overfull boundary cache " << _path << ", starting afresh" << std::endl;
+      unmap();
+      initialize(capacity);
+      return;
+   }
+
+   _header->count = count;
+}
+
+// Truncates the file and lays out an empty table of at least the given number of slots.
+void BoundaryCache::initialize(const size_t capacity)
+{
+   // Round the number of slots up to a power of two.
+   size_t slots = 16;
+
+   while (slots < capacity)
+      slots <<= 1;
+
+   if (ftruncate(_fd, 0) != 0)
+      throw std::runtime_error("Unable to reset boundary cache " + _path);
+
+   map(slots);
+
+   _header->capacity = slots;
+   _header->count    = 0;
+
+   // Written last, so a partially initialized file is rejected.
+   memcpy(_header->magic, Magic, sizeof(Magic));
+}
+
+// Retrieves the boundaries stored under the given key, if any.
+bool BoundaryCache::find(const uint64_t key, IrisBoundary& pupil, IrisBoundary& limbus)
+{
+   const Entry* entry = slot(key);
+
+   if (!entry || entry->key != key)
+   {
+      ++_misses;
+      return false;
+   }
+
+   pupil  = IrisBoundary(IrisBoundary::Pupil,  entry->pupil[0],  entry->pupil[1],
+                                               entry->pupil[2],  entry->pupil[3]);
+   limbus = IrisBoundary(IrisBoundary::Limbus, entry->limbus[0], entry->limbus[1],
+                                               entry->limbus[2], entry->limbus[3]);
+   ++_hits;
+
+   return true;
+}
+
+// Stores the boundaries under the given key.
+void BoundaryCache::insert(const uint64_t key, const IrisBoundary& pupil,
+                                               const IrisBoundary& limbus)
+{
+   // Keep the table at most half full.
+   if (2 * (_header->count + 1) > _header->capacity)
+      grow();
+
+   Entry* entry = slot(key);
+
+   if (!entry)
+      throw std::runtime_error("Boundary cache " + _path + " is full");
+
+   const bool added = entry->key != key;
+
+   // Fill the payload before publishing the key, so an interrupted insert leaves no entry.
+   store(entry->pupil,  pupil);
+   store(entry->limbus, limbus);
+
+   std::atomic_signal_fence(std::memory_order_seq_cst);
+
+   if (added)
+   {
+      entry->key = key;
+      ++_header->count;
+   }
+}
+
+float BoundaryCache::hitRate() const
+{
+   const size_t lookups = _hits + _misses;
+
+   return lookups ? float(_hits) / lookups : 0;
+}
+
+// Maps the file, sized to hold the given number of slots.
+void BoundaryCache::map(const size_t capacity)
+{
+   _bytes = sizeof(Header) + capacity * sizeof(Entry);
+
+   void* data = MAP_FAILED;
+
+   if (ftruncate(_fd, _bytes) == 0)
+      data = mmap(NULL, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+   if (data == MAP_FAILED)
+      throw std::runtime_error("Unable to map boundary cache " + _path);
+
+   _header  = (Header*)data;
+   _entries = (Entry*)(_header + 1);
+}
+
+void BoundaryCache::unmap()
+{
+   if (_header)
+   {
+      msync(_header, _bytes, MS_SYNC);
+      munmap(_header, _bytes);
+   }
+
+   _header  = nullptr;
+   _entries = nullptr;
+}
+
+// Doubles the number of slots, rehashing existing entries.
+void BoundaryCache::grow()
+{
+   vector<Entry> entries;
+
+   for (size_t i = 0; i < _header->capacity; ++i)
+      if (_entries[i].key)
+         entries.push_back(_entries[i]);
+
+   const size_t capacity = 2 * _header->capacity;
+
+   unmap();
+
+   // On failure, fall back to the existing slots, which are still intact in the file.
+   try
+   {
+      map(capacity);
+   }
+   catch (...)
+   {
+      map(capacity / 2);
+      throw;
+   }
+
+   memset(_entries, 0, capacity * sizeof(Entry));
+   _header->capacity = capacity;
+   _header->count    = entries.size();
+
+   for (const auto& e : entries)
+      *slot(e.key) = e;
+}
+
+// Slot holding the key, or the empty slot where it belongs (linear probing).
+// Returns null if the table is full and the key absent.
+BoundaryCache::Entry* BoundaryCache::slot(const uint64_t key) const
+{
+   const size_t mask = _header->capacity - 1;
+
+   for (size_t n = 0, i = key & mask; n < _header->capacity; ++n, i = (i + 1) & mask)
+      if (_entries[i].key == key || _entries[i].key == 0)
+         return _entries + i;
+
+   return nullptr;
+}
@@ -9,6 +9,9 @@
 #include "irisFinder.h"
 #include <opencv2/imgcodecs.hpp>
 #include <stdint.h>                            // for uint8_t type
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
 
 #ifdef NDEBUG
 
@@ -37,6 +40,16 @@ Mat image,               // the unaltered raw image
     hough;               // used for determining approximate pupil center
 #endif
 
+// Working memory, in bytes per pixel, used to plan against the memory budget.
+static const size_t ResidentBytesPerPixel = 15, // raw, contrast and mask planes, three gradient planes
+                    PupilBytesPerPixel    =  8, // pupil, gradient, hough and LED masks
+                    RadiusBytesPerPixel   =  2; // hough accumulator, per pupil radius
+
+static inline size_t bytes(const Mat& m)
+{
+   return m.total() * m.elemSize();
+}
+
 static inline Mat getKernel(const int kSize, const int shape = cv::MORPH_ELLIPSE)
 {
    return getStructuringElement(shape, cv::Size2d(kSize, kSize));
@@ -53,23 +66,34 @@ static inline bool inside(unsigned int x, unsigned int y, const Mat& m)
    return x >= 1 && y >= 1 && x <= m.cols - 2 && y <= m.rows - 2;
 }
 
-void IrisFinder::setImage(const Mat& image)
+// Prepares only the raw image and LED mask, which is all that normalization needs.
+void IrisFinder::prepareImage(const Mat& image)
 {
+   // Release the previous image's planes first, so they never count against this image's budget.
+   _raw.release();
+   _image.release();
+   _gradX.release();
+   _gradY.release();
+   _gradMag.release();
+   _mask.release();
+
+   _peakBytes = 0;
+
    // If color image, utilize only the red channel.
    if (image.channels() > 1)
-      extractChannel(image, _image, 2);
+      extractChannel(image, _raw, 2);
    else
-      _image = image;
+      _raw = image;
 
    // Convert image to single-channel 8-bit depth.
-   _image.convertTo(_image, CV_8UC1);
+   _raw.convertTo(_raw, CV_8UC1);
 
 #ifdef NDEBUG
-   ::image = _image.clone();
+   ::image = _raw.clone();
 #endif
 
    // Identify extremely bright pixels in the image.
-   threshold(_image, _mask, MinLedIntensity, 255, cv::THRESH_BINARY_INV);
+   threshold(_raw, _mask, MinLedIntensity, 255, cv::THRESH_BINARY_INV);
 
    // Erode bright pixel mask to connect neighbours.
    erode(_mask, _mask, LedDilation);
@@ -84,6 +108,8 @@ void IrisFinder::setImage(const Mat& image)
 
    connectedComponentsWithStats(_mask == 0, labels, stats, centroids);
 
+   account(bytes(labels) + bytes(stats) + bytes(centroids) + _mask.total());
+
    for (int r = 0; r < _mask.rows; ++r)
       for (int c = 0; c < _mask.cols; ++c)
       {
@@ -103,12 +129,25 @@ void IrisFinder::setImage(const Mat& image)
 #ifdef NDEBUG
    ::mask = _mask.clone();
 #endif
+}
+
+void IrisFinder::setImage(const Mat& image)
+{
+   // The image planes plus a single band of pupil radii must fit in the budget.
+   const size_t pixels = image.total();
+
+   if (MemoryBudget && MemoryBudget < (ResidentBytesPerPixel + PupilBytesPerPixel +
+                                       RadiusBytesPerPixel) * pixels)
+      throw std::runtime_error("Memory budget too small for image");
+
+   prepareImage(image);
 
    // Apply horizontal open operation, to help reduce noise introduced by eyelashes.
    const cv::Size kSize(EyelashThickness, 1);
    const Mat kernel = getStructuringElement(cv::MORPH_RECT, kSize);
 
-   morphologyEx(_image, _image, cv::MORPH_CLOSE, kernel);
+   // The raw image is kept intact, for normalization.
+   morphologyEx(_raw, _image, cv::MORPH_CLOSE, kernel);
 
    // Blur the image, to smooth out gradient directions.
    GaussianBlur(_image, _image, Size2f(), GradientSigma);
@@ -127,6 +166,9 @@ void IrisFinder::setImage(const Mat& image)
 
    magnitude(_gradX, _gradY, _gradMag);
 
+   // Localization is const, so account for the pupil search's masks and hough band here.
+   account((PupilBytesPerPixel + RadiusBytesPerPixel * radiusBand()) * pixels);
+
 #ifdef NDEBUG
    ::contrast = _image.clone();
    bitwise_and(::contrast, _mask, ::contrast);
@@ -183,6 +225,13 @@ void IrisFinder::boundaries(IrisBoundary& pupil, IrisBoundary& limbus) const
 // Localize the pupil.
 void IrisFinder::pupilBoundary(IrisBoundary& pupil) const
 {
+   // Nothing to localize without the gradient planes from setImage.
+   if (_gradMag.empty())
+   {
+      pupil = IrisBoundary(Pupil);
+      return;
+   }
+
    pupil.type = Pupil;
 
    // Binarize by thresholding on the pixel intensity.
@@ -212,65 +261,102 @@ void IrisFinder::pupilBoundary(IrisBoundary& pupil) const
 
    cv::findContours(houghMask, contours, hierarchy, cv::RETR_LIST, cv::CHAIN_APPROX_NONE);
 
-   const int numRadii = MaxPupilRadius - MinPupilRadius;
-   Mat accum = Mat::zeros(_image.size(), CV_16SC(numRadii));
+   const int numRadii  = MaxPupilRadius - MinPupilRadius,
+             bandRadii = radiusBand();
 
-   int maxScore = -1,
-         radius = 0;
+   int maxScore = 0,
+         radius = 0,
+         bestR  = 0,
+         bestX  = 0,
+         bestY  = 0;
 
-   // Foreach contour.
-   for (const auto& contour : contours)
-      if (contour.size() >= MinPupilContourLength)
-         // Foreach point along the contour.
-         for (const auto& p : contour)
-         {
-            float cx = p.x,
-                  cy = p.y;
+#ifdef NDEBUG
+   ::hough = Mat::zeros(_image.size(), CV_32F);
+#endif
+
+   // Accumulate a band of radii at a time, to stay within the memory budget.
+   for (int lo = 0; lo < numRadii; lo += bandRadii)
+   {
+      const int hi = std::min(lo + bandRadii, numRadii);
 
-            const float mag = _gradMag.at<float>(p),
-                         dx = _gradX.at<float>(p) / -mag,
-                         dy = _gradY.at<float>(p) / -mag;
+      Mat accum = Mat::zeros(_image.size(), CV_16SC(hi - lo));
 
-            // Iterate over all possible radii.
-            for (int cr = 0; cr < MaxPupilRadius; ++cr, cx += dx, cy += dy)
+      // Foreach contour.
+      for (const auto& contour : contours)
+         if (contour.size() >= MinPupilContourLength)
+            // Foreach point along the contour.
+            for (const auto& p : contour)
             {
-               // Stop if point falls outside the image.
-               if (!inside(cx, cy, _image))
-                  break;
+               float cx = p.x,
+                     cy = p.y;
 
-               // Stop if hit another prospective pupil boundary.
-               if (cr > 1 && houghMask.at<uint8_t>(cy, cx) > 0 && noLedNearBy.at<uint8_t>(cy, cx) > 0)
-                  break;
+               const float mag = _gradMag.at<float>(p),
+                            dx = _gradX.at<float>(p) / -mag,
+                            dy = _gradY.at<float>(p) / -mag;
 
-               if (cr >= MinPupilRadius)
+               // Iterate over all possible radii.
+               for (int cr = 0; cr < MaxPupilRadius; ++cr, cx += dx, cy += dy)
                {
-                  const int ri = cr - MinPupilRadius;
+                  // Stop if point falls outside the image.
+                  if (!inside(cx, cy, _image))
+                     break;
+
+                  // Stop if hit another prospective pupil boundary.
+                  if (cr > 1 && houghMask.at<uint8_t>(cy, cx) > 0 && noLedNearBy.at<uint8_t>(cy, cx) > 0)
+                     break;
+
+                  if (cr >= MinPupilRadius)
+                  {
+                     const int ri = cr - MinPupilRadius;
 
-                  // Loop over immediate neighbourhood.
-                  for (int x = cx - 1; x <= cx + 1; ++x)
-                     for (int y = cy - 1; y <= cy + 1; ++y)
-                     {
-                        short* radii = (short*)accum.ptr(y, x);
+                     // Remaining radii vote only into later bands.
+                     if (ri - 1 >= hi)
+                        break;
 
-                        for (int r = ri - 1; r <= ri + 1; ++r)
+                     if (ri + 1 < lo)
+                        continue;
+
+                     // Loop over immediate neighbourhood.
+                     for (int x = cx - 1; x <= cx + 1; ++x)
+                        for (int y = cy - 1; y <= cy + 1; ++y)
                         {
-                           // Could apply any neighbourhood weighting function here.
-                           radii[r] += 4 - fabs(x - cx) + fabs(y - cy) + abs(r - ri);
+                           short* radii = (short*)accum.ptr(y, x);
 
-                           // See if new maximum found.
-                           if (radii[r] > maxScore)
+                           for (int r = std::max(ri - 1, lo); r <= std::min(ri + 1, hi - 1); ++r)
                            {
-                              maxScore = radii[r];
-
-                              pupil.x = x;
-                              pupil.y = y;
-                              pupil.a = pupil.b = r + MinPupilRadius + 1;
+                              // Could apply any neighbourhood weighting function here.
+                              radii[r - lo] += 4 - fabs(x - cx) + fabs(y - cy) + abs(r - ri);
+
+                              const int score = radii[r - lo];
+
+                              // See if new maximum found. Votes only increase a cell, so every
+                              // cell ending at the maximum is seen here; ties go to the smallest
+                              // (radius, y, x), independent of how the radii are banded.
+                              if (score > maxScore ||
+                                  (score == maxScore &&
+                                   std::make_tuple(r, y, x) < std::make_tuple(bestR, bestY, bestX)))
+                              {
+                                 maxScore = score;
+
+                                 bestR = r;
+                                 bestY = y;
+                                 bestX = x;
+                              }
                            }
                         }
-                     }
-               }
-            } // end foreach radii
-         } // end foreach contour point
+                  }
+               } // end foreach radii
+            } // end foreach contour point
+
+#ifdef NDEBUG
+      for (int y = 0; y < _image.rows; ++y)
+         for (int x = 0; x < _image.cols; ++x)
+         {
+            const short* ptr = (short*)accum.ptr(y, x);
+            ::hough.at<float>(y, x) += std::accumulate(ptr, ptr + hi - lo, 0);
+         }
+#endif
+   } // end foreach band
 
 #ifdef NDEBUG
    ::houghMask = 0.3 * pupilMask + 0.6 * gradMask;
@@ -278,27 +364,31 @@ void IrisFinder::pupilBoundary(IrisBoundary& pupil) const
 
    ::houghLines = houghMask;
 
-   ::hough = Mat::zeros(_image.size(), CV_32F);
-
-   for (int y = 0; y < _image.rows; ++y)
-      for (int x = 0; x < _image.cols; ++x)
-      {
-         const short* ptr = (short*)accum.ptr(y, x);
-         ::hough.at<float>(y, x) = std::accumulate(ptr, ptr + numRadii, 0);
-      }
-
    normalize(::hough, ::hough, 0, 255, cv::NORM_MINMAX);
    ::hough.convertTo(::hough, CV_8U);
 #endif
 
    // Fine tune the pupil fit.
-   if (maxScore > -1)
+   if (maxScore > 0)
+   {
+      pupil.x = bestX;
+      pupil.y = bestY;
+      pupil.a = pupil.b = bestR + MinPupilRadius + 1;
+
       optimizeFit(pupil);
+   }
 }
 
 // Localize the limbus boundary.
 void IrisFinder::limbusBoundary(IrisBoundary& limbus, const IrisBoundary& pupil) const
 {
+   // Nothing to localize without the gradient planes from setImage.
+   if (_gradMag.empty())
+   {
+      limbus = IrisBoundary(Limbus);
+      return;
+   }
+
    // If pupil not found, limbus can't be found either.
    if (pupil.x == -1 || pupil.y == -1)
    {
@@ -369,6 +459,9 @@ void IrisFinder::limbusBoundary(IrisBoundary& limbus, const IrisBoundary& pupil)
 // A variation of Daugman's integro-differential equation.
 float IrisFinder::boundaryStrength(const IrisBoundary& boundary) const
 {
+   if (_gradMag.empty())
+      return 0;
+
    const float radius = fmin(boundary.a, boundary.b);
 
    if (boundary.type == IrisBoundary::Pupil && radius < MinPupilRadius)
@@ -420,6 +513,107 @@ float IrisFinder::boundaryStrength(const IrisBoundary& boundary) const
    return sum * eccentricity * length;
 }
 
+// Unwraps the annulus into a polar strip, sampling along rays between the two boundaries.
+void IrisFinder::normalizedIris(const IrisBoundary& pupil, const IrisBoundary& limbus,
+                                Mat& iris, Mat1b& mask) const
+{
+   if (!pupil.valid() || !limbus.valid() || _raw.empty())
+   {
+      iris.release();
+      mask.release();
+
+      return;
+   }
+
+   // Boundary points at each sampled angle.
+   cv::Mat1f pupilX(1, NormalizedWidth),  pupilY(1, NormalizedWidth),
+             limbusX(1, NormalizedWidth), limbusY(1, NormalizedWidth);
+
+   for (int i = 0; i < NormalizedWidth; ++i)
+   {
+      const float theta = 2 * M_PI * i / NormalizedWidth,
+                  cosT  = cos(theta),
+                  sinT  = sin(theta);
+
+      pupilX(i)  = pupil.x  + pupil.a  * cosT;
+      pupilY(i)  = pupil.y  + pupil.b  * sinT;
+      limbusX(i) = limbus.x + limbus.a * cosT;
+      limbusY(i) = limbus.y + limbus.b * sinT;
+   }
+
+   // Each row of the sampling maps blends linearly from the pupil to the limbus.
+   cv::Mat1f mapX(NormalizedHeight, NormalizedWidth),
+             mapY(NormalizedHeight, NormalizedWidth);
+
+   for (int r = 0; r < NormalizedHeight; ++r)
+   {
+      const double t = NormalizedHeight > 1 ? double(r) / (NormalizedHeight - 1) : 0;
+
+      Mat rowX = mapX.row(r),
+          rowY = mapY.row(r);
+
+      addWeighted(pupilX, 1 - t, limbusX, t, 0, rowX);
+      addWeighted(pupilY, 1 - t, limbusY, t, 0, rowY);
+   }
+
+   // Sample the image and LED mask; anything outside the image counts as occluded.
+   remap(_raw,  iris, mapX, mapY, cv::INTER_LINEAR,  cv::BORDER_CONSTANT, cv::Scalar(0));
+   remap(_mask, mask, mapX, mapY, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+}
+
+// Number of pupil radii whose hough accumulator fits in the memory budget at once.
+int IrisFinder::radiusBand() const
+{
+   const int numRadii = MaxPupilRadius - MinPupilRadius;
+
+   if (!MemoryBudget)
+      return numRadii;
+
+   const size_t pixels = _image.total(),
+                fixed  = (ResidentBytesPerPixel + PupilBytesPerPixel) * pixels;
+
+   if (MemoryBudget <= fixed)
+      return 1;
+
+   const size_t radii = (MemoryBudget - fixed) / (RadiusBytesPerPixel * pixels);
+
+   return std::max(1, (int)std::min<size_t>(radii, numRadii));
+}
+
+size_t IrisFinder::residentBytes() const
+{
+   return bytes(_raw) + bytes(_image) + bytes(_mask) +
+          bytes(_gradX) + bytes(_gradY) + bytes(_gradMag);
+}
+
+// Updates the peak working memory with the given transient usage.
+void IrisFinder::account(const size_t transient)
+{
+   _peakBytes = std::max(_peakBytes, residentBytes() + transient);
+}
+
+// Normalizes an image whose boundaries are already known, skipping gradient computation.
+void IrisFinder::normalizedIris(const Mat& image, const IrisBoundary& pupil,
+                                const IrisBoundary& limbus, Mat& iris, Mat1b& mask)
+{
+   prepareImage(image);
+   normalizedIris(pupil, limbus, iris, mask);
+}
+
+// Lists every parameter that influences localization.
+void IrisFinder::parameters(vector<float>& params) const
+{
+   params = { float(MinLedArea),            float(MaxLedArea),
+              float(MinLedIntensity),       float(LedDilation),
+              float(LedErode),              float(MinLedNeighbourhood),
+              float(EyelashThickness),      float(MinPupilRadius),
+              float(MaxPupilRadius),        float(MaxPupilIntensity),
+              float(MinPupilContourLength), float(MinAnnulusThickness),
+              float(MinLimbusRadius),       float(MaxLimbusRadius),
+              GradientSigma,                MinBoundaryGradient,
+              AngleTolerance };
+}
+
 void IrisFinder::optimizeFit(IrisBoundary& boundary) const
 {
    // Helper class that extends DownhillSolver::Function.
@@ -7,23 +7,32 @@
 * other characteristic.
 */
 #include "irisFinder.h"
+#include "boundaryCache.h"
 #include <opencv2/ximgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/core.hpp>
 #include <sstream>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
 
 using namespace std;
 
 int main(int argc, char* argv[])
 {
-   const string keys = "{@i   | | path to image     }"
-                       "{help | | show this message }";
+   const string keys = "{@i    | | path to image                             }"
+                       "{list  | | file listing image paths, one per line    }"
+                       "{cache | | path to persistent boundary cache         }"
+                       "{strip | | directory to write normalized iris strips }"
+                       "{budget| | working memory budget per image, in MB     }"
+                       "{help  | | show this message                         }";
 
    // Parse arguments.
    cv::CommandLineParser parser(argc, argv, keys);
 
    // Print help message.
-   if (parser.has("help") || !parser.has("@i")) {
+   if (parser.has("help") || !(parser.has("@i") || parser.has("list"))) {
       parser.printMessage();
       return EXIT_SUCCESS;
    }
@@ -34,19 +43,160 @@ int main(int argc, char* argv[])
       return EXIT_FAILURE;
    }
 
-   const string imgPath = parser.get<string>("@i");
+   // Gather the image paths to process.
+   vector<string> imgPaths;
 
-   const cv::Mat img = cv::imread(imgPath);
+   if (parser.has("@i"))
+      imgPaths.push_back(parser.get<string>("@i"));
 
-   const IrisFinder irisFinder(img);
+   if (parser.has("list")) {
+      ifstream list(parser.get<string>("list"));
 
-   IrisBoundary pupil,
-                limbus;
+      if (!list) {
+         cerr << "Unable to read " << parser.get<string>("list") << endl;
+         return EXIT_FAILURE;
+      }
 
-   irisFinder.boundaries(pupil, limbus);
+      for (string line; getline(list, line); )
+         if (!line.empty())
+            imgPaths.push_back(line);
+   }
 
-   cout << pupil << " " << limbus << endl;
+   const bool batch = imgPaths.size() > 1 || parser.has("list");
 
-   return EXIT_SUCCESS;
-}
+   // Open the result cache, if requested.
+   unique_ptr<BoundaryCache> cache;
+   size_t cacheHits   = 0,
+          cacheMisses = 0;
+
+   if (parser.has("cache")) {
+      try {
+         cache.reset(new BoundaryCache(parser.get<string>("cache")));
+      }
+      catch (const exception& e) {
+         cerr << e.what() << endl;
+         return EXIT_FAILURE;
+      }
+   }
+
+   // Check the normalized iris output directory up front.
+   if (parser.has("strip")) {
+      struct stat st;
+
+      if (stat(parser.get<string>("strip").c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+         cerr << "No such directory " << parser.get<string>("strip") << endl;
+         return EXIT_FAILURE;
+      }
+   }
+
+   int status = EXIT_SUCCESS;
+
+   IrisFinder irisFinder;
+
+   if (parser.has("budget")) {
+      const double budget = parser.get<double>("budget") * (1 << 20);
+
+      // Negated test also rejects NaN.
+      if (!(budget >= 1 && budget < SIZE_MAX)) {
+         cerr << "Invalid memory budget " << parser.get<string>("budget") << endl;
+         return EXIT_FAILURE;
+      }
+
+      irisFinder.MemoryBudget = budget;
+   }
+
+   for (const auto& imgPath : imgPaths) {
+      const cv::Mat img = cv::imread(imgPath);
+
+      if (img.empty()) {
+         cerr << "Unable to read " << imgPath << endl;
+         status = EXIT_FAILURE;
+         continue;
+      }
+
+      IrisBoundary pupil,
+                   limbus;
+
+      // On a cache hit, skip localization (and preprocessing, unless normalizing).
+      const uint64_t key = cache ? BoundaryCache::key(img, irisFinder) : 0;
+
+      size_t peakBytes = 0;
 
+      const bool hit = cache && cache->find(key, pupil, limbus);
+
+      try {
+         if (!hit) {
+            irisFinder.setImage(img);
+            irisFinder.boundaries(pupil, limbus);
+            peakBytes = irisFinder.peakBytes();
+         }
+      }
+      catch (const exception& e) {
+         cerr << imgPath << ": " << e.what() << endl;
+         status = EXIT_FAILURE;
+         continue;
+      }
+
+      // A cache that failed to grow is no longer usable; carry on without it.
+      if (cache && !hit) {
+         try {
+            cache->insert(key, pupil, limbus);
+         }
+         catch (const exception& e) {
+            cerr << e.what() << ", disabling boundary cache" << endl;
+            cacheHits   += cache->hits();
+            cacheMisses += cache->misses();
+            cache.reset();
+         }
+      }
+
+      // Unwrap the iris while the preprocessed image is still resident.
+      if (parser.has("strip")) {
+         cv::Mat   iris;
+         cv::Mat1b mask;
+
+         // With cached boundaries, only the raw image and LED mask need preparing.
+         if (hit) {
+            irisFinder.normalizedIris(img, pupil, limbus, iris, mask);
+            peakBytes = irisFinder.peakBytes();
+         }
+         else
+            irisFinder.normalizedIris(pupil, limbus, iris, mask);
+
+         if (!iris.empty()) {
+            const string dir  = parser.get<string>("strip"),
+                         name = imgPath.substr(imgPath.find_last_of('/') + 1),
+                         stem = dir + "/" + name.substr(0, name.find_last_of('.'));
+
+            if (!cv::imwrite(stem + "_iris.png", iris) || !cv::imwrite(stem + "_mask.png", mask)) {
+               cerr << "Unable to write normalized iris for " << imgPath << " to " << dir << endl;
+               status = EXIT_FAILURE;
+            }
+         }
+      }
+
+      if (batch)
+         cout << imgPath << " ";
+
+      cout << pupil << " " << limbus;
+
+      if (parser.has("budget"))
+         cout << " Peak: " << peakBytes;
+
+      cout << endl;
+   }
+
+   if (parser.has("cache")) {
+      if (cache) {
+         cacheHits   += cache->hits();
+         cacheMisses += cache->misses();
+      }
+
+      const size_t lookups = cacheHits + cacheMisses;
+
+      cerr << "Cache hits: " << cacheHits << "/" << lookups
+           << " (" << (lookups ? 100. * cacheHits / lookups : 0) << "%)" << endl;
+   }
+
+   return status;
+}